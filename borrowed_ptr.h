@@ -0,0 +1,90 @@
+/************************************************************
+■borrowed_ptr
+	shared_ptrを借りるだけの、所有権を持たないpointer。
+
+	shared_ptrを値渡しすると、呼び出しごとに count の ++ と -- が発生する。
+	読むだけの関数には borrowed_ptr を渡せば、countには一切触れない。
+	関数の中で保持し続ける必要が出たら、to_shared() で明示的に shared_ptr を得る。
+
+	-	元の shared_ptr より長生きしてはいけない。
+		SMARTPTR_CHECK_BORROWS を定義して build すると、元の shared_ptr が破棄・再代入・moveされた時点で
+		借りている borrowed_ptr が残っていれば assert で止まる(debug用。NDEBUG未定義で使う)。
+		shared_ptr / borrowed_ptr の layout が変わるので、全ての翻訳単位で定義を揃えること。
+		定義しなければ borrowed_ptr は { ptr, count } だけで、元の shared_ptr に一切書き込まない。
+	-	一時objectからは作れない。
+************************************************************/
+#pragma once
+
+#include "shared.h"
+
+template < typename T >
+class borrowed_ptr
+{
+private :
+	T * ptr = nullptr ;
+	std::size_t * count = nullptr ;
+#ifdef SMARTPTR_CHECK_BORROWS
+	const shared_ptr< T > * source = nullptr ;
+#endif
+
+	void attach( const shared_ptr< T > * _source )
+	{
+#ifdef SMARTPTR_CHECK_BORROWS
+		source = _source ;
+		if ( source ) ++source->borrows ;
+#else
+		( void )_source ;
+#endif
+	}
+	const shared_ptr< T > * source_ptr() const
+	{
+#ifdef SMARTPTR_CHECK_BORROWS
+		return source ;
+#else
+		return nullptr ;
+#endif
+	}
+
+	void detach()
+	{
+#ifdef SMARTPTR_CHECK_BORROWS
+		if ( source ) --source->borrows ;
+		source = nullptr ;
+#endif
+	}
+
+public :
+	borrowed_ptr() { }
+	borrowed_ptr( const shared_ptr< T > & r ) : ptr( r.ptr ), count( r.count )
+	{
+		attach( &r ) ;
+	}
+	borrowed_ptr( shared_ptr< T > && ) = delete ;
+
+	~borrowed_ptr() { detach() ; }
+
+	borrowed_ptr( const borrowed_ptr & r ) : ptr( r.ptr ), count( r.count )
+	{
+		attach( r.source_ptr() ) ;
+	}
+	borrowed_ptr & operator =( const borrowed_ptr & r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		detach() ;
+		ptr = r.ptr ;
+		count = r.count ;
+		attach( r.source_ptr() ) ;
+		return *this ;
+	}
+
+	// 明示的に所有権を得る
+	shared_ptr< T > to_shared() const { return shared_ptr< T >( ptr, count ) ; }
+
+	T & operator * () const noexcept { return *ptr ; }
+	T * operator ->() const noexcept { return ptr ; }
+	T * get() const noexcept { return ptr ; }
+
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
+} ;
@@ -0,0 +1,56 @@
+/************************************************************
+■cow_ptr (copy on write)
+	shared_ptrの上に作った、値semanticsのpointer。
+
+	-	copyは shared_ptr のcopy(count++)だけ。objectはcopyしない。
+	-	読み出し(operator*, operator->, get)は共有したobjectをそのまま参照する。
+	-	書き込み(write)の時、所有者が自分だけでなければ(!unique())、その時点で初めてobjectをcloneする。
+
+	copyしたが一度も書き込まなかった値は、deep copyが一切発生しない。
+	※ write() で得た T & を、その後の copy を跨いで保持しないこと。
+	   copy した時点で object は再び共有されるので、その参照経由の書き込みは copy 先にも見えてしまう。
+	   書き込む度に write() を呼び直す。
+	※ shared.h のcountはthread safeではないので、cow_ptrも同一threadでの使用を前提とする。
+************************************************************/
+#pragma once
+
+#include <cassert>
+#include <utility>
+#include "shared.h"
+
+template < typename T >
+class cow_ptr
+{
+private :
+	shared_ptr< T > ptr ;
+
+public :
+	cow_ptr() { }
+	explicit cow_ptr( T * _ptr ) : ptr( _ptr ) { }
+
+	// copy, moveは shared_ptr に任せる
+
+	// 読み出し : 共有したまま
+	const T & operator * () const noexcept { return *ptr ; }
+	const T * operator ->() const noexcept { return ptr.get() ; }
+	const T * get() const noexcept { return ptr.get() ; }
+
+	// 書き込み : 共有されていれば、ここでclone
+	T & write()
+	{
+		assert( ptr ) ;
+		if ( !ptr.unique() )
+			ptr = shared_ptr< T >( new T( *ptr ) ) ;
+		return *ptr ;
+	}
+
+	std::size_t use_count() const noexcept { return ptr.use_count() ; }
+	bool unique() const noexcept { return ptr.unique() ; }
+	explicit operator bool() const noexcept { return bool( ptr ) ; }
+} ;
+
+template < typename T, typename ... Args >
+cow_ptr< T > make_cow( Args && ... args )
+{
+	return cow_ptr< T >( new T( std::forward< Args >( args ) ... ) ) ;
+}
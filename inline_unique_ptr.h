@@ -0,0 +1,153 @@
+/************************************************************
+■inline_unique_ptr
+	unique_ptrと同じく所有権はただ一つ(copy不可、move ok)。
+	ただし、派生classのobjectが N byte 以内に収まる場合は、heapではなく自身の内部bufferに構築する。
+	収まらない場合は、これまで通りheapに確保する。
+
+	std::vector< inline_unique_ptr<Base> > のように並べても、小さなobjectなら要素ごとのnewが無い。
+
+	-	Derived は Base の public派生 class であること。
+	-	buffer内のobjectはmoveの際に move constructor で移し替えるので、
+		inlineに置くのは nothrow move constructible な型のみ。
+************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template < typename Base, std::size_t N = 3 * sizeof( void * ) >
+class inline_unique_ptr
+{
+private :
+	// 実際の型(Derived)を知っている関数table
+	struct ops {
+		bool is_inline ;
+		Base * ( *move )( void * dst, Base * src ) ;	// inlineのみ : dstへ移し替え、srcは破棄
+		void ( *destroy )( Base * p ) ;
+	} ;
+
+	template < typename D >
+	struct inline_ops {
+		static Base * move( void * dst, Base * src )
+		{
+			D * s = static_cast< D * >( src ) ;
+			D * d = ::new( dst ) D( std::move( *s ) ) ;
+			s->~D() ;
+			return d ;
+		}
+		static void destroy( Base * p ) { static_cast< D * >( p )->~D() ; }
+		static const ops table ;
+	} ;
+
+	template < typename D >
+	struct heap_ops {
+		static void destroy( Base * p ) { delete static_cast< D * >( p ) ; }
+		static const ops table ;
+	} ;
+
+	template < typename D >
+	struct fits : std::integral_constant< bool,
+		sizeof( D ) <= N &&
+		alignof( std::max_align_t ) % alignof( D ) == 0 &&
+		std::is_nothrow_move_constructible< D >::value > { } ;
+
+	alignas( std::max_align_t ) unsigned char buf[ N ] ;
+	Base * ptr = nullptr ;
+	const ops * table = nullptr ;
+
+	template < typename D, typename ... Args >
+	void construct( std::true_type, Args && ... args )
+	{
+		ptr = ::new( static_cast< void * >( buf ) ) D( std::forward< Args >( args ) ... ) ;
+		table = &inline_ops< D >::table ;
+	}
+
+	template < typename D, typename ... Args >
+	void construct( std::false_type, Args && ... args )
+	{
+		ptr = new D( std::forward< Args >( args ) ... ) ;
+		table = &heap_ops< D >::table ;
+	}
+
+	void steal( inline_unique_ptr & r ) noexcept
+	{
+		if ( r.ptr == nullptr ) return ;
+
+		table = r.table ;
+		ptr = table->is_inline ? table->move( buf, r.ptr ) : r.ptr ;
+
+		r.ptr = nullptr ;
+		r.table = nullptr ;
+	}
+
+public :
+	inline_unique_ptr() { }
+	explicit inline_unique_ptr( Base * _ptr ) : ptr( _ptr ), table( _ptr ? &heap_ops< Base >::table : nullptr ) { }
+
+	~inline_unique_ptr() { reset() ; }
+
+	// コピーは禁止
+	inline_unique_ptr( const inline_unique_ptr & ) = delete ;
+	inline_unique_ptr & operator =( const inline_unique_ptr & ) = delete ;
+
+	// ムーブ
+	inline_unique_ptr( inline_unique_ptr && r ) noexcept { steal( r ) ; }
+	inline_unique_ptr & operator = ( inline_unique_ptr && r ) noexcept
+	{
+		if ( this == &r )
+			return *this ;
+
+		reset() ;
+		steal( r ) ;
+		return *this ;
+	}
+
+	// 収まればbuffer、収まらなければheapに構築
+	template < typename D, typename ... Args >
+	void emplace( Args && ... args )
+	{
+		static_assert( std::is_base_of< Base, D >::value, "D must derive from Base" ) ;
+
+		reset() ;
+		construct< D >( fits< D >(), std::forward< Args >( args ) ... ) ;
+	}
+
+	void reset() noexcept
+	{
+		if ( ptr == nullptr ) return ;
+
+		table->destroy( ptr ) ;
+		ptr = nullptr ;
+		table = nullptr ;
+	}
+
+	bool is_inline() const noexcept { return ptr != nullptr && table->is_inline ; }
+
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
+
+	Base & operator * () const noexcept { return *ptr ; }
+	Base * operator ->() const noexcept { return ptr ; }
+	Base * get() const noexcept { return ptr ; }
+} ;
+
+template < typename Base, std::size_t N >
+template < typename D >
+const typename inline_unique_ptr< Base, N >::ops inline_unique_ptr< Base, N >::inline_ops< D >::table = {
+	true, &inline_ops< D >::move, &inline_ops< D >::destroy
+} ;
+
+template < typename Base, std::size_t N >
+template < typename D >
+const typename inline_unique_ptr< Base, N >::ops inline_unique_ptr< Base, N >::heap_ops< D >::table = {
+	false, nullptr, &heap_ops< D >::destroy
+} ;
+
+template < typename Base, typename D, std::size_t N = 3 * sizeof( void * ), typename ... Args >
+inline_unique_ptr< Base, N > make_inline_unique( Args && ... args )
+{
+	inline_unique_ptr< Base, N > p ;
+	p.template emplace< D >( std::forward< Args >( args ) ... ) ;
+	return p ;
+}
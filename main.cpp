@@ -36,7 +36,9 @@
 		
 ************************************************************/
 
+#ifndef TEST
 #define TEST -1
+#endif
 
 /************************************************************
 概要
@@ -751,6 +753,433 @@ auto_ptr
 		delete raw_ptr;
 	}
 	
+/************************************************************
+自作headerのcheck
+	assertで確認する。並行処理のものは multi threadで動かす。
+	build例 : g++ -std=c++20 -O2 -pthread -DTEST=27 main.cpp
+************************************************************/
+#elif(TEST == 27)
+	/******************************
+	sharded_shared_ptr : copy/破棄 と retire() の競合
+		各threadがcopyと破棄を繰り返している最中に、配布元が retire() する。
+		全threadが手放した時点で、objectがちょうど1回だけ解放されることを確認。
+	******************************/
+	#include<atomic>
+	#include<cassert>
+	#include<cstdio>
+	#include<thread>
+	#include<vector>
+	#include "sharded_shared_ptr.h"
+	
+	std::atomic<int> alive(0);
+	struct schema{
+		int version;
+		schema(int v) : version(v) { ++alive; }
+		~schema() { --alive; }
+	};
+	
+	int main(){
+		const int THREADS = 8;
+		
+		for(int round = 0; round < 100; ++round){
+			sharded_shared_ptr<schema> current = make_sharded<schema>(round);
+			std::vector< sharded_shared_ptr<schema> > seeds(THREADS, current);
+			std::atomic<int> started(0);
+			
+			std::vector<std::thread> threads;
+			for(int t = 0; t < THREADS; ++t){
+				threads.emplace_back([&, t]{
+					sharded_shared_ptr<schema> mine = std::move(seeds[t]);
+					++started;
+					std::vector< sharded_shared_ptr<schema> > held;
+					for(int i = 0; i < 10000; ++i){
+						held.push_back(mine);	// copy
+						assert(held.back()->version == round);
+						if(held.size() > 4) held.erase(held.begin());	// 破棄
+					}
+					if(t % 2) mine.retire();	// retire済みのobjectへの retire() は通常の破棄と同じ
+				});
+			}
+			
+			while(started < THREADS) std::this_thread::yield();
+			current.retire();	// 他threadがcopy/破棄している最中に集計
+			
+			for(auto& th : threads) th.join();
+			assert(alive == 0);
+		}
+		printf("ok\n");
+	}
+	
+#elif(TEST == 28)
+	/******************************
+	mpmc_queue : unique_ptr の受け渡し
+		producer : try_push と push_batch
+		consumer : pop_batch と pop_wait(空の間は寝て待つ)
+		全producer終了後に close() し、consumerが全要素を受け取って抜けることを確認。
+		queueを小さくして、満杯/空 の両方が頻繁に起きるようにしている。
+	******************************/
+	#include<atomic>
+	#include<cassert>
+	#include<cstdio>
+	#include<stdexcept>
+	#include<thread>
+	#include<vector>
+	#include "mpmc_queue.h"
+	
+	std::atomic<long> alive(0);
+	struct work{
+		long id;
+		work(long _id) : id(_id) { ++alive; }
+		~work() { --alive; }
+	};
+	
+	int main(){
+		const int PRODUCERS = 4;
+		const int CONSUMERS = 4;
+		const long ITEMS = 50000;	// producer 1つあたり
+		
+		// capacityの確認
+		bool thrown = false;
+		try{ mpmc_queue<work> bad(0); }catch(std::invalid_argument&){ thrown = true; }
+		assert(thrown);
+		
+		// 0個の batch はすぐ戻る。空の unique_ptr は push できない
+		{
+			mpmc_queue<work> small(4);
+			assert(small.try_push(unique_ptr<work>(new work(0))));
+			unique_ptr<work> none[2];
+			assert(small.push_batch(none, 0) == 0);
+			assert(small.pop_batch(none, 0) == 0);
+			
+			unique_ptr<work> empty;
+			assert(!small.try_push(std::move(empty)));
+			unique_ptr<work> mixed[3];
+			mixed[0].reset(new work(1));
+			mixed[2].reset(new work(2));
+			assert(small.push_batch(mixed, 3) == 1);	// 空の要素の手前まで
+			assert(!mixed[0] && mixed[2]);
+		}
+		assert(alive == 0);	// queueに残った要素も destructor で解放される
+		
+		mpmc_queue<work> queue(16);
+		std::atomic<long> received(0), sum(0);
+		
+		std::vector<std::thread> consumers;
+		for(int c = 0; c < CONSUMERS; ++c){
+			consumers.emplace_back([&, c]{
+				unique_ptr<work> batch[8];
+				for(;;){
+					if(c % 2){
+						std::size_t n = queue.pop_batch(batch, 8);
+						for(std::size_t i = 0; i < n; ++i){
+							sum += batch[i]->id;
+							++received;
+							batch[i].reset();
+						}
+						if(n) continue;
+					}
+					unique_ptr<work> w = queue.pop_wait();
+					if(!w) return;	// close済みで空
+					sum += w->id;
+					++received;
+				}
+			});
+		}
+		
+		std::vector<std::thread> producers;
+		for(int p = 0; p < PRODUCERS; ++p){
+			producers.emplace_back([&, p]{
+				for(long i = 0; i < ITEMS; ){
+					if(p % 2){
+						unique_ptr<work> batch[4];
+						std::size_t m = 0;
+						for(; m < 4 && i + long(m) < ITEMS; ++m) batch[m].reset(new work(i + long(m)));
+						
+						std::size_t done = 0;
+						while(done < m){
+							done += queue.push_batch(batch + done, m - done);	// 満杯なら入った分だけ
+							if(done < m) std::this_thread::yield();
+						}
+						i += long(m);
+					}else{
+						unique_ptr<work> w(new work(i));
+						while(!queue.try_push(std::move(w))) std::this_thread::yield();	// 失敗時、wは所有権を持ったまま
+						++i;
+					}
+				}
+			});
+		}
+		
+		for(auto& th : producers) th.join();
+		queue.close();
+		for(auto& th : consumers) th.join();
+		
+		assert(received == PRODUCERS * ITEMS);
+		assert(sum == PRODUCERS * (ITEMS * (ITEMS - 1) / 2));
+		assert(alive == 0);
+		printf("ok\n");
+	}
+	
+#elif(TEST == 29)
+	/******************************
+	slot_map : handleの有効/無効
+		- erase後、slotが再利用されても古いhandleは nullptr
+		- null_handle はどのobjectも指さない
+		- swap and pop で移動したobjectのhandleも有効なまま
+		- 構築中に例外が出ても、size() と既存のhandleは変わらない
+	******************************/
+	#include<cassert>
+	#include<cstdio>
+	#include<string>
+	#include "slot_map.h"
+	
+	struct item{
+		int value;
+		item(int v) : value(v) { if(v < 0) throw v; }
+	};
+	
+	int main(){
+		slot_map<item> map;
+		assert(map.get(slot_map<item>::null_handle) == nullptr);
+		
+		slot_map<item>::handle a = map.emplace(1);
+		slot_map<item>::handle b = map.emplace(2);
+		slot_map<item>::handle c = map.emplace(3);
+		assert(map.get(slot_map<item>::null_handle) == nullptr);
+		
+		// a を消すと、末尾の c が a の位置に移る
+		assert(map.erase(a));
+		assert(map.get(a) == nullptr);
+		assert(map.get(b)->value == 2);
+		assert(map.get(c)->value == 3);
+		assert(map.size() == 2);
+		
+		// a のslotを再利用。古い a は無効のまま
+		slot_map<item>::handle d = map.emplace(4);
+		assert(std::uint32_t(d) == std::uint32_t(a));	// 同じslot
+		assert(d != a);								// generationが違う
+		assert(map.get(a) == nullptr);
+		assert(map.get(d)->value == 4);
+		assert(!map.erase(a));
+		
+		// 例外 : 何も変わらない
+		bool thrown = false;
+		try{ map.emplace(-1); }catch(int){ thrown = true; }
+		assert(thrown);
+		assert(map.size() == 3);
+		assert(map.get(b)->value == 2 && map.get(c)->value == 3 && map.get(d)->value == 4);
+		
+		slot_map<item>::handle e = map.emplace(5);
+		assert(map.get(e)->value == 5 && map.size() == 4);
+		
+		int sum = 0;
+		for(const item& i : map) sum += i.value;
+		assert(sum == 2 + 3 + 4 + 5);
+		
+		map.clear();
+		assert(map.empty() && map.get(b) == nullptr && map.get(e) == nullptr);
+		printf("ok\n");
+	}
+	
+#elif(TEST == 30)
+	/******************************
+	segment / offset_ptr : processを跨いだ共有
+		- create_file した segment に offset_ptr で繋いだ list を作り、set_root で登録
+		- fork した子processで open_file し直し(別address)、root<T>() から辿る
+		- deallocate したblockが、同じ size class の allocate で再利用される
+		- segment の末尾を越える allocate は bad_alloc
+	******************************/
+	#include<cassert>
+	#include<cstdio>
+	#include<new>
+	#include<sys/wait.h>
+	#include<unistd.h>
+	#include "offset_smart_ptr.h"
+	
+	struct node{
+		int value;
+		offset_unique_ptr<node> next;
+		offset_shared_ptr<int> shared;	// 全nodeで共有
+		node(int v) : value(v) { }
+	};
+	struct list{
+		offset_unique_ptr<node> head;
+	};
+	
+	const char* PATH = "segment_test.bin";
+	const int NODES = 100;
+	
+	// 子process : 別のaddressに map し直して辿る
+	int child(){
+		segment seg = segment::open_file(PATH);
+		list* l = seg.root<list>();
+		if(l == nullptr) return 1;
+		
+		int n = 0;
+		for(node* p = l->head.get(); p; p = p->next.get()){
+			if(p->value != n || *p->shared != 77) return 2;
+			++n;
+		}
+		if(n != NODES) return 3;
+		if(l->head->shared.use_count() != NODES + 1) return 4;	// 親の手元の1つ + 各node
+		return 0;
+	}
+	
+	int main(){
+		segment seg = segment::create_file(PATH, 1 << 20);
+		
+		offset_unique_ptr<list> l = make_offset_unique<list>(seg);
+		offset_shared_ptr<int> shared = make_offset_shared<int>(seg, 77);
+		offset_unique_ptr<node>* tail = &l->head;
+		for(int i = 0; i < NODES; ++i){
+			*tail = make_offset_unique<node>(seg, i);
+			(*tail)->shared = shared;
+			tail = &(*tail)->next;
+		}
+		seg.set_root(l.get());
+		
+		pid_t pid = fork();
+		if(pid == 0) _exit(child());
+		int status = 0;
+		waitpid(pid, &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		
+		// 同じprocess内でも、別のaddressに map し直して辿れる
+		{
+			segment again = segment::open_file(PATH);
+			assert(again.data() != seg.data());
+			assert(again.root<list>()->head->next->value == 1);
+		}
+		
+		// free list : 解放したblockが同じ size class で再利用される
+		void* a = seg.allocate(40);
+		void* b = seg.allocate(40);
+		segment::deallocate(a);
+		segment::deallocate(b);
+		assert(seg.allocate(40) == b);	// 後に解放した方から
+		assert(seg.allocate(48) == a);	// 同じ size class(64 byte block)
+		assert(seg.allocate(40) != a);	// free listが空になったら新しいblock
+		
+		// list を解放すると、nodeのblockも free list に戻る
+		// (先頭nodeは後続を破棄した後に解放されるので、free listの先頭になる)
+		node* first = l->head.get();
+		l->head.reset();
+		assert(shared.use_count() == 1);
+		offset_unique_ptr<node> reused = make_offset_unique<node>(seg, 0);
+		assert(reused.get() == first);
+		
+		// segment の末尾を越える確保
+		bool thrown = false;
+		try{ seg.allocate(1 << 20); }catch(std::bad_alloc&){ thrown = true; }
+		assert(thrown);
+		
+		unlink(PATH);
+		printf("ok\n");
+	}
+	
+#elif(TEST == 31)
+	/******************************
+	weak_cache : get_or_create の競合
+		- 多数のthreadが同じkeyで同時に get_or_create しても make は1回、全員が同じobjectを得る
+		- make が例外を投げたら、待っていたthreadの1つが作り直す
+		- objectが消えた entry は purge() で消える
+	build例 : g++ -std=c++17 -O2 -pthread -DTEST=31 main.cpp
+	******************************/
+	#include<atomic>
+	#include<cassert>
+	#include<chrono>
+	#include<cstdio>
+	#include<memory>
+	#include<stdexcept>
+	#include<thread>
+	#include<vector>
+	#include "weak_cache.h"
+	
+	std::atomic<int> alive(0);
+	struct value{
+		int key;
+		value(int k) : key(k) { ++alive; }
+		~value() { --alive; }
+	};
+	
+	int main(){
+		const int THREADS = 16;
+		weak_cache<int, value> cache;
+		
+		// 1. 同じkeyに同時アクセス : make は1回
+		{
+			std::atomic<int> builds(0);
+			std::atomic<int> ready(0);
+			std::vector< std::shared_ptr<value> > got(THREADS);
+			std::vector<std::thread> threads;
+			for(int t = 0; t < THREADS; ++t){
+				threads.emplace_back([&, t]{
+					++ready;
+					while(ready < THREADS) std::this_thread::yield();
+					got[t] = cache.get_or_create(7, [&]{
+						++builds;
+						std::this_thread::sleep_for(std::chrono::milliseconds(50));	// 他threadを待たせる
+						return std::make_shared<value>(7);
+					});
+				});
+			}
+			for(auto& th : threads) th.join();
+			
+			assert(builds == 1);
+			for(auto& p : got) assert(p == got[0] && p->key == 7);
+			assert(cache.find(7) == got[0]);
+		}
+		assert(alive == 0);
+		assert(cache.find(7) == nullptr);	// 誰も持っていなければ返らない
+		
+		// 2. make が例外 : 待っていたthreadが作り直す
+		{
+			std::atomic<int> attempts(0);
+			std::atomic<int> failures(0);
+			std::vector< std::shared_ptr<value> > got(THREADS);
+			std::vector<std::thread> threads;
+			for(int t = 0; t < THREADS; ++t){
+				threads.emplace_back([&, t]{
+					try{
+						got[t] = cache.get_or_create(8, [&]{
+							std::this_thread::sleep_for(std::chrono::milliseconds(50));
+							if(attempts++ == 0) throw std::runtime_error("first build fails");
+							return std::make_shared<value>(8);
+						});
+					}catch(std::runtime_error&){
+						++failures;
+					}
+				});
+			}
+			for(auto& th : threads) th.join();
+			
+			assert(failures == 1);		// 例外は作成したthreadにだけ届く
+			assert(attempts == 2);		// 作り直しは1回だけ
+			std::shared_ptr<value> built;
+			for(auto& p : got) if(p) built = p;
+			for(auto& p : got) assert(!p || p == built);
+			assert(built && built->key == 8);
+		}
+		
+		// 3. purge : objectが消えた entry を掃除
+		{
+			std::vector< std::shared_ptr<value> > keep;
+			for(int k = 100; k < 110; ++k){
+				std::shared_ptr<value> p = cache.get_or_create(k, [k]{ return std::make_shared<value>(k); });
+				if(k % 2 == 0) keep.push_back(p);	// 偶数keyだけ生かす
+			}
+			cache.purge();
+			assert(cache.size() == keep.size());
+			for(int k = 100; k < 110; ++k) assert(bool(cache.find(k)) == (k % 2 == 0));
+			
+			keep.clear();
+			cache.purge();
+			assert(cache.size() == 0);
+		}
+		assert(alive == 0);
+		printf("ok\n");
+	}
+	
 #endif
 
 /************************************************************
@@ -0,0 +1,211 @@
+/************************************************************
+■mpmc_queue
+	unique_ptr を thread間で受け渡すための、容量固定の lock-free queue。
+	(multi producer / multi consumer、ring buffer)
+
+	-	push は unique_ptr を move で受け取り、pop は unique_ptr を返す。
+		queue内では raw pointer で持つが、所有権は常に queue か 取り出した側 のどちらか一方にある。
+		呼び出し側が release() / 再adopt する必要はない。
+	-	1要素の受け渡しは、位置を進める CAS 1回 + slotの sequence 更新のみ。allocationも lock も無い。
+	-	push_batch / pop_batch は、連続した k 個の slot を 1回の CAS でまとめて確保する。
+	-	pop_wait は queue が空の間、std::atomic::wait(futex相当)で寝て待つ。
+		producer は寝ている consumer がいる時だけ notify する。
+	-	close() 後、pop_wait は queue が空になった時点で空の unique_ptr を返す。
+	-	空の unique_ptr は push できない(try_push は false、push_batch はその手前で止まる)。
+		pop 側の「空の unique_ptr = queue が空」と区別できなくなるため。
+
+	各slotの sequence で「誰の番か」を表す(Dmitry Vyukov の bounded MPMC queue)。
+		seq == pos		: producer が pos に書いて良い
+		seq == pos + 1	: consumer が pos から読んで良い
+	※ std::atomic::wait を使うので C++20 が必要。
+************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "unique.h"
+
+template < typename T >
+class mpmc_queue
+{
+private :
+	struct cell {
+		std::atomic< std::size_t > seq ;
+		T * data ;
+	} ;
+
+	cell * cells ;
+	const std::size_t mask ;
+
+	alignas( 64 ) std::atomic< std::size_t > enqueue_pos ;
+	alignas( 64 ) std::atomic< std::size_t > dequeue_pos ;
+
+	// consumer を寝かせる/起こす
+	alignas( 64 ) std::atomic< std::uint32_t > epoch ;
+	std::atomic< std::uint32_t > waiters ;
+	std::atomic< bool > closed ;
+
+	// pos から最大 n 個、seq == pos + i + d の slot が続く数
+	std::size_t ready( std::size_t pos, std::size_t n, std::size_t d ) const noexcept
+	{
+		std::size_t k = 0 ;
+		while ( k < n && cells[ ( pos + k ) & mask ].seq.load( std::memory_order_acquire ) == pos + k + d ) ++k ;
+		return k ;
+	}
+
+	// 最大 n 個の slot を確保し、先頭位置を pos に返す。確保数を返す
+	std::size_t claim( std::atomic< std::size_t > & head, std::size_t n, std::size_t d, std::size_t & pos ) noexcept
+	{
+		pos = head.load( std::memory_order_relaxed ) ;
+		if ( n == 0 ) return 0 ;
+
+		for ( ;; ){
+			std::size_t k = ready( pos, n, d ) ;
+			if ( k == 0 ){
+				std::size_t seq = cells[ pos & mask ].seq.load( std::memory_order_acquire ) ;
+				// 満杯(push) / 空(pop)
+				if ( std::intptr_t( seq - ( pos + d ) ) < 0 ) return 0 ;
+				pos = head.load( std::memory_order_relaxed ) ;
+				continue ;
+			}
+			if ( head.compare_exchange_weak( pos, pos + k, std::memory_order_relaxed ) ) return k ;
+		}
+	}
+
+	static std::size_t checked_capacity( std::size_t capacity )
+	{
+		if ( capacity < 2 || ( capacity & ( capacity - 1 ) ) != 0 )
+			throw std::invalid_argument( "mpmc_queue: capacity must be a power of two >= 2" ) ;
+		return capacity ;
+	}
+
+	void wake() noexcept
+	{
+		std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+		if ( waiters.load( std::memory_order_relaxed ) != 0 ){
+			epoch.fetch_add( 1, std::memory_order_release ) ;
+			epoch.notify_all() ;
+		}
+	}
+
+public :
+	// capacity は 2以上の 2のべき乗。そうでなければ std::invalid_argument
+	explicit mpmc_queue( std::size_t capacity )
+	: cells( new cell[ checked_capacity( capacity ) ] ), mask( capacity - 1 ),
+	  enqueue_pos( 0 ), dequeue_pos( 0 ), epoch( 0 ), waiters( 0 ), closed( false )
+	{
+		for ( std::size_t i = 0 ; i < capacity ; ++i ){
+			cells[i].seq.store( i, std::memory_order_relaxed ) ;
+			cells[i].data = nullptr ;
+		}
+	}
+
+	~mpmc_queue()
+	{
+		// 残っている要素を位置で数えて解放する(他threadはもう触っていない前提)
+		std::size_t pos ;
+		while ( claim( dequeue_pos, 1, 1, pos ) != 0 ) delete cells[ pos & mask ].data ;
+		delete[] cells ;
+	}
+
+	// コピーは禁止
+	mpmc_queue( const mpmc_queue & ) = delete ;
+	mpmc_queue & operator =( const mpmc_queue & ) = delete ;
+
+	// 満杯、または p が空なら false。その時 p は所有権を持ったまま
+	bool try_push( unique_ptr< T > && p )
+	{
+		if ( !p ) return false ;
+
+		std::size_t pos ;
+		if ( claim( enqueue_pos, 1, 0, pos ) == 0 ) return false ;
+
+		cell & c = cells[ pos & mask ] ;
+		c.data = p.release() ;
+		c.seq.store( pos + 1, std::memory_order_release ) ;
+		wake() ;
+		return true ;
+	}
+
+	// 空なら空の unique_ptr
+	unique_ptr< T > try_pop()
+	{
+		std::size_t pos ;
+		if ( claim( dequeue_pos, 1, 1, pos ) == 0 ) return unique_ptr< T >() ;
+
+		cell & c = cells[ pos & mask ] ;
+		unique_ptr< T > p( c.data ) ;
+		c.seq.store( pos + mask + 1, std::memory_order_release ) ;
+		return p ;
+	}
+
+	// items[0..n) を先頭から入るだけ push し、push した数を返す。
+	// push された要素は空になり、残りは所有権を持ったまま。空の要素があれば、その手前までしか push しない
+	std::size_t push_batch( unique_ptr< T > * items, std::size_t n )
+	{
+		for ( std::size_t i = 0 ; i < n ; ++i ){
+			if ( !items[i] ){
+				n = i ;
+				break ;
+			}
+		}
+
+		std::size_t pos ;
+		std::size_t k = claim( enqueue_pos, n, 0, pos ) ;
+		for ( std::size_t i = 0 ; i < k ; ++i ){
+			cell & c = cells[ ( pos + i ) & mask ] ;
+			c.data = items[i].release() ;
+			c.seq.store( pos + i + 1, std::memory_order_release ) ;
+		}
+		if ( k ) wake() ;
+		return k ;
+	}
+
+	// 最大 n 個を out に pop し、pop した数を返す
+	std::size_t pop_batch( unique_ptr< T > * out, std::size_t n )
+	{
+		std::size_t pos ;
+		std::size_t k = claim( dequeue_pos, n, 1, pos ) ;
+		for ( std::size_t i = 0 ; i < k ; ++i ){
+			cell & c = cells[ ( pos + i ) & mask ] ;
+			out[i].reset( c.data ) ;
+			c.seq.store( pos + i + mask + 1, std::memory_order_release ) ;
+		}
+		return k ;
+	}
+
+	// 要素が来るまで寝て待つ。close() 済みで空なら空の unique_ptr
+	unique_ptr< T > pop_wait()
+	{
+		for ( ;; ){
+			if ( unique_ptr< T > p = try_pop() ) return p ;
+
+			waiters.fetch_add( 1, std::memory_order_relaxed ) ;
+			std::atomic_thread_fence( std::memory_order_seq_cst ) ;
+			std::uint32_t e = epoch.load( std::memory_order_acquire ) ;
+
+			unique_ptr< T > p = try_pop() ;
+			if ( !p && !closed.load( std::memory_order_acquire ) ) epoch.wait( e, std::memory_order_acquire ) ;
+			waiters.fetch_sub( 1, std::memory_order_relaxed ) ;
+
+			if ( p ) return p ;
+			if ( closed.load( std::memory_order_acquire ) ){
+				if ( unique_ptr< T > q = try_pop() ) return q ;
+				return unique_ptr< T >() ;
+			}
+		}
+	}
+
+	// 以後、pop_wait は空になったら待たずに戻る
+	void close() noexcept
+	{
+		closed.store( true, std::memory_order_release ) ;
+		epoch.fetch_add( 1, std::memory_order_release ) ;
+		epoch.notify_all() ;
+	}
+
+	std::size_t capacity() const noexcept { return mask + 1 ; }
+} ;
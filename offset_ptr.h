@@ -0,0 +1,61 @@
+/************************************************************
+■offset_ptr
+	address ではなく「自分自身からの距離(byte)」を保持するpointer。
+
+	mmapしたfileや shared memory は、processごとに map される address が違う。
+	生の T * を segment 内に書いても、別のprocessでは意味を持たない。
+	offset_ptr は指す先と自分自身が同じsegment内にあれば、どのaddressに map されても正しく辿れる。
+
+	-	nullptr は offset 1 で表す(0 は「自分自身を指す」ので使えない)。
+	-	copy すると、copy先の位置から offset を計算し直す。
+	-	別objectを指す pointer 同士の引き算/足し算は未定義なので、計算は std::uintptr_t で行う。
+************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+template < typename T >
+class offset_ptr
+{
+private :
+	static const std::ptrdiff_t null_offset = 1 ;
+
+	std::ptrdiff_t offset = null_offset ;
+
+	std::uintptr_t self() const noexcept { return reinterpret_cast< std::uintptr_t >( this ) ; }
+
+	void set( T * p ) noexcept
+	{
+		offset = p ? std::ptrdiff_t( reinterpret_cast< std::uintptr_t >( p ) - self() ) : null_offset ;
+	}
+
+public :
+	offset_ptr() { }
+	offset_ptr( std::nullptr_t ) { }
+	offset_ptr( T * p ) { set( p ) ; }
+
+	offset_ptr( const offset_ptr & r ) { set( r.get() ) ; }
+	offset_ptr & operator =( const offset_ptr & r )
+	{
+		set( r.get() ) ;
+		return *this ;
+	}
+	offset_ptr & operator =( T * p )
+	{
+		set( p ) ;
+		return *this ;
+	}
+
+	T * get() const noexcept
+	{
+		if ( offset == null_offset ) return nullptr ;
+		return reinterpret_cast< T * >( self() + std::uintptr_t( offset ) ) ;
+	}
+
+	typename std::add_lvalue_reference< T >::type operator * () const noexcept { return *get() ; }
+	T * operator ->() const noexcept { return get() ; }
+
+	explicit operator bool() const noexcept { return offset != null_offset ; }
+} ;
@@ -0,0 +1,174 @@
+/************************************************************
+■offset_unique_ptr / offset_shared_ptr
+	segment 内のobjectを所有する smart pointer。中身は offset_ptr なので、segment 内に置ける。
+
+	-	offset_unique_ptr : 破棄時に ~T() を呼び、blockを segment に返す。
+	-	offset_shared_ptr : count と T を1つのblockに置く。countも segment 内にあるので、
+						 複数のprocessから共有しても正しく数えられる(countはlock-freeなatomic)。
+
+	作成は make_offset_unique / make_offset_shared で、確保先の segment を渡す(それ以外の pointer は所有できない)。
+	解放先の segment は block header から分かるので、pointer自身は segment を覚えていない。
+************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include "offset_ptr.h"
+#include "segment.h"
+
+template < typename T >
+class offset_unique_ptr
+{
+private :
+	offset_ptr< T > ptr ;
+
+	// segment::allocate で確保したobjectのみ。make_offset_unique からだけ作る
+	template < typename U, typename ... Args >
+	friend offset_unique_ptr< U > make_offset_unique( segment & seg, Args && ... args ) ;
+
+	explicit offset_unique_ptr( T * _ptr ) : ptr( _ptr ) { }
+
+public :
+	offset_unique_ptr() { }
+
+	~offset_unique_ptr() { reset() ; }
+
+	// コピーは禁止
+	offset_unique_ptr( const offset_unique_ptr & ) = delete ;
+	offset_unique_ptr & operator =( const offset_unique_ptr & ) = delete ;
+
+	// ムーブ
+	offset_unique_ptr( offset_unique_ptr && r ) : ptr( r.ptr ) { r.ptr = nullptr ; }
+	offset_unique_ptr & operator = ( offset_unique_ptr && r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		reset() ;
+		ptr = r.ptr ;
+		r.ptr = nullptr ;
+		return *this ;
+	}
+
+	void reset() noexcept
+	{
+		T * p = ptr.get() ;
+		if ( p == nullptr ) return ;
+
+		p->~T() ;
+		segment::deallocate( p ) ;
+		ptr = nullptr ;
+	}
+
+	T & operator * () const noexcept { return *ptr ; }
+	T * operator ->() const noexcept { return ptr.get() ; }
+	T * get() const noexcept { return ptr.get() ; }
+
+	explicit operator bool() const noexcept { return bool( ptr ) ; }
+} ;
+
+template < typename T >
+class offset_shared_ptr
+{
+private :
+	static_assert( ATOMIC_LLONG_LOCK_FREE == 2, "process-shared count needs lock-free atomics" ) ;
+
+	struct control {
+		std::atomic< std::uint64_t > count ;
+		T value ;
+
+		template < typename ... Args >
+		explicit control( Args && ... args ) : count( 1 ), value( std::forward< Args >( args ) ... ) { }
+	} ;
+
+	template < typename U, typename ... Args >
+	friend offset_shared_ptr< U > make_offset_shared( segment & seg, Args && ... args ) ;
+
+	offset_ptr< control > ctrl ;
+
+	void release() noexcept
+	{
+		control * c = ctrl.get() ;
+		if ( c == nullptr ) return ;
+
+		if ( c->count.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ){
+			c->~control() ;
+			segment::deallocate( c ) ;
+		}
+		ctrl = nullptr ;
+	}
+
+public :
+	offset_shared_ptr() { }
+	~offset_shared_ptr() { release() ; }
+
+	offset_shared_ptr( const offset_shared_ptr & r ) : ctrl( r.ctrl )
+	{
+		if ( ctrl ) ctrl->count.fetch_add( 1, std::memory_order_relaxed ) ;
+	}
+	offset_shared_ptr & operator =( const offset_shared_ptr & r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ctrl = r.ctrl ;
+		if ( ctrl ) ctrl->count.fetch_add( 1, std::memory_order_relaxed ) ;
+		return *this ;
+	}
+
+	offset_shared_ptr( offset_shared_ptr && r ) : ctrl( r.ctrl ) { r.ctrl = nullptr ; }
+	offset_shared_ptr & operator =( offset_shared_ptr && r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ctrl = r.ctrl ;
+		r.ctrl = nullptr ;
+		return *this ;
+	}
+
+	void reset() noexcept { release() ; }
+
+	T & operator * () const noexcept { return ctrl->value ; }
+	T * operator ->() const noexcept { return get() ; }
+	T * get() const noexcept { return ctrl ? &ctrl->value : nullptr ; }
+
+	std::uint64_t use_count() const noexcept { return ctrl ? ctrl->count.load( std::memory_order_relaxed ) : 0 ; }
+	explicit operator bool() const noexcept { return bool( ctrl ) ; }
+} ;
+
+template < typename T, typename ... Args >
+offset_unique_ptr< T > make_offset_unique( segment & seg, Args && ... args )
+{
+	static_assert( alignof( T ) <= 16, "segment payloads are only 16-byte aligned" ) ;
+
+	void * mem = seg.allocate( sizeof( T ) ) ;
+	try {
+		return offset_unique_ptr< T >( ::new( mem ) T( std::forward< Args >( args ) ... ) ) ;
+	} catch ( ... ){
+		segment::deallocate( mem ) ;
+		throw ;
+	}
+}
+
+template < typename T, typename ... Args >
+offset_shared_ptr< T > make_offset_shared( segment & seg, Args && ... args )
+{
+	static_assert( alignof( T ) <= 16, "segment payloads are only 16-byte aligned" ) ;
+	typedef typename offset_shared_ptr< T >::control control ;
+
+	void * mem = seg.allocate( sizeof( control ) ) ;
+	offset_shared_ptr< T > r ;
+	try {
+		r.ctrl = ::new( mem ) control( std::forward< Args >( args ) ... ) ;
+	} catch ( ... ){
+		segment::deallocate( mem ) ;
+		throw ;
+	}
+	return r ;
+}
@@ -0,0 +1,269 @@
+/************************************************************
+■segment
+	mmapしたfile / POSIX shared memory を、1つのarenaとして使う。
+
+	-	create_file / create_shm で作成し、segment内に offset_ptr で繋いだ構造を構築する。
+	-	別のprocessは open_file / open_shm で map するだけで、同じ構造をそのまま(copy無しで)使える。
+	-	起点となるobjectは set_root() で登録し、root<T>() で取り出す。
+
+	allocator
+		block = [ 16byte header | payload ]、大きさは 2のべき乗(size class)。
+		解放されたblockは size class 毎の free list に戻し、次の同じclassの確保で再利用する。
+		free list も segment 内の offset で持つので、processを跨いでそのまま使える。
+		確保/解放は segment 内の spin lock で排他する(lock-freeなatomicはprocess間でも有効)。
+
+	segment 内に置く型は、生pointerを持たないこと(offset_ptr を使う)。
+************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "offset_ptr.h"
+
+class segment
+{
+private :
+	static const std::uint64_t magic = 0x31544e454d474553ull ;	// "SEGMENT1"
+	static const std::size_t min_class = 5 ;	// 32 byte
+	static const std::size_t num_class = 64 ;
+	static const std::size_t block_align = 16 ;
+
+	static_assert( ATOMIC_INT_LOCK_FREE == 2, "process-shared lock needs lock-free atomics" ) ;
+
+	struct header {
+		std::uint64_t magic ;
+		std::uint64_t size ;
+		std::atomic< std::uint32_t > lock ;
+		std::uint64_t top ;							// 未使用領域の先頭(baseからのoffset)
+		std::uint64_t free_head[ num_class ] ;		// baseからのoffset、0は空
+		offset_ptr< void > root ;
+	} ;
+
+	// payloadの直前に置く
+	struct block {
+		std::ptrdiff_t to_base ;	// blockから segment 先頭までの距離
+		std::uint64_t size_class ;
+	} ;
+	static_assert( sizeof( block ) == block_align, "block header must keep payload aligned" ) ;
+
+	// 1回に確保できる payload の最大値(最大の size class から block header を除いた分)
+	static const std::size_t max_allocation = ( std::size_t( 1 ) << ( num_class - 1 ) ) - sizeof( block ) ;
+
+	static const std::uint64_t first_block = ( sizeof( header ) + block_align - 1 ) / block_align * block_align ;
+
+	char * base = nullptr ;
+	std::size_t length = 0 ;
+	int fd = -1 ;
+
+	header * hdr() const noexcept { return reinterpret_cast< header * >( base ) ; }
+
+	static void lock( header * h ) noexcept
+	{
+		while ( h->lock.exchange( 1, std::memory_order_acquire ) != 0 ){ }
+	}
+	static void unlock( header * h ) noexcept
+	{
+		h->lock.store( 0, std::memory_order_release ) ;
+	}
+
+	// n <= max_allocation であること
+	static std::size_t class_of( std::size_t n ) noexcept
+	{
+		std::size_t c = min_class ;
+		while ( ( std::size_t( 1 ) << c ) < n + sizeof( block ) ) ++c ;
+		return c ;
+	}
+
+	static void fail( const char * what )
+	{
+		throw std::system_error( errno, std::generic_category(), what ) ;
+	}
+
+	void map( int _fd, std::size_t _length, bool init )
+	{
+		fd = _fd ;
+		length = _length ;
+
+		void * p = ::mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 ) ;
+		if ( p == MAP_FAILED ){
+			::close( fd ) ;
+			fd = -1 ;
+			fail( "mmap" ) ;
+		}
+		base = static_cast< char * >( p ) ;
+
+		if ( init ){
+			header * h = ::new( base ) header() ;
+			h->magic = magic ;
+			h->size = length ;
+			h->lock.store( 0 ) ;
+			h->top = first_block ;
+		}else if ( length < first_block || hdr()->magic != magic || hdr()->size != length ){
+			unmap() ;
+			throw std::runtime_error( "segment: not a segment or size mismatch" ) ;
+		}
+	}
+
+	void unmap() noexcept
+	{
+		if ( base ) ::munmap( base, length ) ;
+		if ( fd >= 0 ) ::close( fd ) ;
+		base = nullptr ;
+		length = 0 ;
+		fd = -1 ;
+	}
+
+	// file を作る前に確認する
+	static std::size_t checked_size( std::size_t size )
+	{
+		if ( size < first_block ) throw std::invalid_argument( "segment: size is smaller than the segment header" ) ;
+		return size ;
+	}
+
+	static segment create_fd( int _fd, std::size_t size, const char * what )
+	{
+		if ( _fd < 0 ) fail( what ) ;
+		if ( ::ftruncate( _fd, off_t( size ) ) != 0 ){
+			::close( _fd ) ;
+			fail( "ftruncate" ) ;
+		}
+
+		segment s ;
+		s.map( _fd, size, true ) ;
+		return s ;
+	}
+
+	static segment open_fd( int _fd, const char * what )
+	{
+		if ( _fd < 0 ) fail( what ) ;
+
+		struct stat st ;
+		if ( ::fstat( _fd, &st ) != 0 ){
+			::close( _fd ) ;
+			fail( "fstat" ) ;
+		}
+
+		segment s ;
+		s.map( _fd, std::size_t( st.st_size ), false ) ;
+		return s ;
+	}
+
+	segment() { }
+
+public :
+	static segment create_file( const std::string & path, std::size_t size )
+	{
+		checked_size( size ) ;
+		return create_fd( ::open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 ), size, "open" ) ;
+	}
+	static segment open_file( const std::string & path )
+	{
+		return open_fd( ::open( path.c_str(), O_RDWR ), "open" ) ;
+	}
+
+	// name は "/name" 形式
+	static segment create_shm( const std::string & name, std::size_t size )
+	{
+		checked_size( size ) ;
+		return create_fd( ::shm_open( name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 ), size, "shm_open" ) ;
+	}
+	static segment open_shm( const std::string & name )
+	{
+		return open_fd( ::shm_open( name.c_str(), O_RDWR, 0 ), "shm_open" ) ;
+	}
+	static void remove_shm( const std::string & name ) { ::shm_unlink( name.c_str() ) ; }
+
+	~segment() { unmap() ; }
+
+	// コピーは禁止
+	segment( const segment & ) = delete ;
+	segment & operator =( const segment & ) = delete ;
+
+	// ムーブ
+	segment( segment && r ) : base( r.base ), length( r.length ), fd( r.fd )
+	{
+		r.base = nullptr ;
+		r.length = 0 ;
+		r.fd = -1 ;
+	}
+	segment & operator =( segment && r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		unmap() ;
+		base = r.base ;
+		length = r.length ;
+		fd = r.fd ;
+		r.base = nullptr ;
+		r.length = 0 ;
+		r.fd = -1 ;
+		return *this ;
+	}
+
+	// payloadは16byte alignment
+	void * allocate( std::size_t n )
+	{
+		if ( n > max_allocation ) throw std::bad_alloc() ;
+
+		header * h = hdr() ;
+		std::size_t c = class_of( n ) ;
+		std::uint64_t off ;
+
+		lock( h ) ;
+		if ( h->free_head[c] != 0 ){
+			off = h->free_head[c] ;
+			h->free_head[c] = *reinterpret_cast< std::uint64_t * >( base + off + sizeof( block ) ) ;
+		}else{
+			std::uint64_t bytes = std::uint64_t( 1 ) << c ;
+			if ( h->top + bytes > h->size ){
+				unlock( h ) ;
+				throw std::bad_alloc() ;
+			}
+			off = h->top ;
+			h->top += bytes ;
+		}
+		unlock( h ) ;
+
+		block * b = reinterpret_cast< block * >( base + off ) ;
+		b->to_base = -std::ptrdiff_t( off ) ;
+		b->size_class = c ;
+		return b + 1 ;
+	}
+
+	// どのsegmentのblockかは、block header から分かる
+	static void deallocate( void * p ) noexcept
+	{
+		if ( p == nullptr ) return ;
+
+		block * b = static_cast< block * >( p ) - 1 ;
+		char * seg_base = reinterpret_cast< char * >( b ) + b->to_base ;
+		header * h = reinterpret_cast< header * >( seg_base ) ;
+		std::uint64_t off = std::uint64_t( -b->to_base ) ;
+		std::size_t c = std::size_t( b->size_class ) ;
+
+		lock( h ) ;
+		*static_cast< std::uint64_t * >( p ) = h->free_head[c] ;
+		h->free_head[c] = off ;
+		unlock( h ) ;
+	}
+
+	template < typename T >
+	T * root() const noexcept { return static_cast< T * >( hdr()->root.get() ) ; }
+	void set_root( void * p ) noexcept { hdr()->root = p ; }
+
+	void * data() const noexcept { return base ; }
+	std::size_t size() const noexcept { return length ; }
+} ;
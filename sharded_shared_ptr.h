@@ -0,0 +1,163 @@
+/************************************************************
+■sharded_shared_ptr
+	全threadが毎回copyするような、ごく一部の「熱い」object用のshared_ptr。
+
+	shared_ptrのcountは1word。atomicにしても、全coreが同じcache lineを奪い合うので、
+	copy/破棄はcore数に対してscaleしない。
+	そこで、countを thread毎のslot(cache line毎にpadding)に分散させる。
+
+	-	copy/破棄 : 自threadのslotを ++ / -- するだけ。他coreとcache lineを共有しない。
+	-	slot単体の値は負にもなる(A threadでcopy、B threadで破棄)。合計だけが意味を持つ。
+	-	そのため、普段は「0になった」ことを検出できない。
+		所有者が retire() を呼んだ時点で、全slotを中央のcountに集計(reconcile)し、
+		以後は中央のcountで通常のshared_ptrと同じように管理する。
+
+	注意 : retire() が一度も呼ばれないと、objectは解放されない。
+	schemaの差し替え時など、「この版はもう配らない」と決まった時点で、配布元が retire() する。
+************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+template < typename T, std::size_t Shards = 16 >
+class sharded_shared_ptr
+{
+private :
+	static const std::int64_t collected = INT64_MIN ;	// 集計済みのslot
+	static const std::int64_t bias = std::int64_t( 1 ) << 62 ;	// 集計途中で中央のcountが0を通過しないように
+
+	// 1 slot = 1 cache line
+	struct slot {
+		std::atomic< std::int64_t > value ;
+		char pad[ 64 - sizeof( std::atomic< std::int64_t > ) ] ;
+	} ;
+
+	struct control {
+		T * ptr ;
+		std::atomic< bool > retired ;
+		std::atomic< std::int64_t > global ;
+		slot slots[ Shards ] ;
+
+		explicit control( T * _ptr ) : ptr( _ptr ), retired( false ), global( bias )
+		{
+			for ( slot & s : slots ) s.value.store( 0, std::memory_order_relaxed ) ;
+		}
+		~control() { delete ptr ; }
+	} ;
+
+	T * ptr = nullptr ;
+	control * ctrl = nullptr ;
+
+	static std::size_t shard()
+	{
+		static std::atomic< std::size_t > next( 0 ) ;
+		thread_local std::size_t index = next.fetch_add( 1, std::memory_order_relaxed ) % Shards ;
+		return index ;
+	}
+
+	// 自threadのslotを d だけ動かす。集計済みなら false
+	static bool local_add( control * c, std::int64_t d, std::memory_order order )
+	{
+		std::atomic< std::int64_t > & v = c->slots[ shard() ].value ;
+		std::int64_t cur = v.load( std::memory_order_relaxed ) ;
+		while ( cur != collected ){
+			if ( v.compare_exchange_weak( cur, cur + d, order, std::memory_order_relaxed ) )
+				return true ;
+		}
+		return false ;
+	}
+
+	void acquire()
+	{
+		if ( ctrl == nullptr ) return ;
+		if ( !local_add( ctrl, 1, std::memory_order_relaxed ) )
+			ctrl->global.fetch_add( 1, std::memory_order_relaxed ) ;
+	}
+
+	void release()
+	{
+		if ( ctrl == nullptr ) return ;
+		if ( !local_add( ctrl, -1, std::memory_order_release ) ){
+			if ( ctrl->global.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+				delete ctrl ;
+		}
+		ptr = nullptr ;
+		ctrl = nullptr ;
+	}
+
+public :
+	sharded_shared_ptr() { }
+	explicit sharded_shared_ptr( T * _ptr ) : ptr( _ptr ), ctrl( new control( _ptr ) )
+	{
+		ctrl->slots[ shard() ].value.store( 1, std::memory_order_relaxed ) ;
+	}
+	~sharded_shared_ptr() { release() ; }
+
+	sharded_shared_ptr( const sharded_shared_ptr & r ) : ptr( r.ptr ), ctrl( r.ctrl ) { acquire() ; }
+	sharded_shared_ptr & operator =( const sharded_shared_ptr & r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ptr = r.ptr ;
+		ctrl = r.ctrl ;
+		acquire() ;
+		return *this ;
+	}
+
+	sharded_shared_ptr( sharded_shared_ptr && r ) : ptr( r.ptr ), ctrl( r.ctrl )
+	{
+		r.ptr = nullptr ;
+		r.ctrl = nullptr ;
+	}
+	sharded_shared_ptr & operator =( sharded_shared_ptr && r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ptr = r.ptr ;
+		ctrl = r.ctrl ;
+		r.ptr = nullptr ;
+		r.ctrl = nullptr ;
+		return *this ;
+	}
+
+	// 所有権を放棄し、同時に「以後、配らない」ことを宣言する。
+	// 最初の retire() で全slotを中央のcountへ集計し、bias を外す。
+	void retire()
+	{
+		if ( ctrl == nullptr ) return ;
+		if ( ctrl->retired.exchange( true, std::memory_order_acq_rel ) ){
+			release() ;
+			return ;
+		}
+
+		for ( slot & s : ctrl->slots ){
+			std::int64_t v = s.value.exchange( collected, std::memory_order_acq_rel ) ;
+			ctrl->global.fetch_add( v, std::memory_order_relaxed ) ;
+		}
+
+		// 自分の分 + bias
+		if ( ctrl->global.fetch_sub( bias + 1, std::memory_order_acq_rel ) == bias + 1 )
+			delete ctrl ;
+		ptr = nullptr ;
+		ctrl = nullptr ;
+	}
+
+	T & operator * () const noexcept { return *ptr ; }
+	T * operator ->() const noexcept { return ptr ; }
+	T * get() const noexcept { return ptr ; }
+
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
+} ;
+
+template < typename T, std::size_t Shards = 16, typename ... Args >
+sharded_shared_ptr< T, Shards > make_sharded( Args && ... args )
+{
+	return sharded_shared_ptr< T, Shards >( new T( std::forward< Args >( args ) ... ) ) ;
+}
@@ -2,12 +2,42 @@
 ■スマートポインター
 	https://cpp.rainy.me/040-smart-pointer.html#unique-ptr
 ************************************************************/
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+template < typename T > class borrowed_ptr ;
+template < typename U > struct shared_array_result ;
+
 template < typename T >
 class shared_ptr
 {
+	friend class borrowed_ptr< T > ;
+
 	T * ptr = nullptr ;
 	std::size_t * count = nullptr ;
 
+#ifdef SMARTPTR_CHECK_BORROWS
+	// このshared_ptrから作られて、まだ生きている borrowed_ptr の数(borrowed_ptr.h 参照)
+	mutable std::size_t borrows = 0 ;
+#endif
+	void check_no_borrow() const
+	{
+#ifdef SMARTPTR_CHECK_BORROWS
+		assert( borrows == 0 && "borrowed_ptr outlived its source shared_ptr" ) ;
+#endif
+	}
+
+	// borrowed_ptr::to_shared() 用 : 既存のcountを共有する
+	shared_ptr( T * _ptr, std::size_t * _count ) : ptr( _ptr ), count( _count )
+	{
+		if ( count ) ++*count ;
+	}
+
 	void release(){
 		if ( count == nullptr ) return ;
 
@@ -26,34 +56,43 @@ public :
 	explicit shared_ptr( T * _ptr ) : ptr(_ptr), count( new std::size_t(1) )	{ }
 	~shared_ptr()
 	{
+		check_no_borrow() ;
 		release() ;
 	}
 
 	shared_ptr( const shared_ptr & r )
 	: ptr( r.ptr ), count( r.count )
 	{
-		++*count ;
+		if ( count ) ++*count ;
 	}
 	shared_ptr & operator =( const shared_ptr & r )
 	{
 		if ( this == &r )
 			return *this ;
 
+		check_no_borrow() ;
 		release() ;
 		ptr = r.ptr ;
 		count = r.count ;
-		++*count ;
+		if ( count ) ++*count ;
+		return *this ;
 	}
 
 	shared_ptr( shared_ptr && r )
 	: ptr(r.ptr), count(r.count)
 	{
+		r.check_no_borrow() ;
 		r.ptr = nullptr ;
 		r.count = nullptr ;
 	}
 
 	shared_ptr & operator =( shared_ptr && r )
 	{
+		if ( this == &r )
+			return *this ;
+
+		check_no_borrow() ;
+		r.check_no_borrow() ;
 		release() ;
 		
 		ptr = r.ptr ;
@@ -61,10 +100,165 @@ public :
 		
 		r.ptr = nullptr ;
 		r.count = nullptr ;
+		return *this ;
 	}
 
-	T & operator * () noexcept { return *ptr ; }
-	T * operator ->() noexcept { return ptr ; } 
-	T * get() noexcept { return ptr ; }
+	T & operator * () const noexcept { return *ptr ; }
+	T * operator ->() const noexcept { return ptr ; } 
+	T * get() const noexcept { return ptr ; }
+
+	// 所有者の数
+	std::size_t use_count() const noexcept { return count ? *count : 0 ; }
+	bool unique() const noexcept { return use_count() == 1 ; }
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
 } ;
 
+
+/************************************************************
+■shared_ptr<T[]>
+	std::shared_ptr<int>(new int[10], std::default_delete<int[]>()) と違い、
+	make_shared<T[]>(n) で count、length、要素を 1回のallocationで連続に確保する。
+
+		[ count | length | T[0] T[1] ... T[n-1] ]
+
+	operator[] と size() が使える。
+	make_shared_for_overwrite<T[]>(n) は要素を値初期化しない(intなら不定値のまま)。
+************************************************************/
+template < typename T >
+class shared_ptr< T[] >
+{
+	struct header {
+		std::size_t count ;
+		std::size_t length ;
+	} ;
+
+	static_assert( alignof( T ) <= alignof( std::max_align_t ), "over-aligned T is not supported" ) ;
+
+	// headerの直後、Tのalignmentに合わせた位置から要素
+	static const std::size_t offset = ( sizeof( header ) + alignof( T ) - 1 ) / alignof( T ) * alignof( T ) ;
+
+	T * ptr = nullptr ;
+	header * block = nullptr ;
+
+	template < typename U > friend typename shared_array_result< U >::type make_shared( std::size_t n ) ;
+	template < typename U > friend typename shared_array_result< U >::type make_shared_for_overwrite( std::size_t n ) ;
+
+	static void destroy( T * p, std::size_t n )
+	{
+		while ( n > 0 ) p[--n].~T() ;
+	}
+
+	// make_shared / make_shared_for_overwrite の本体
+	static shared_ptr create( std::size_t n, bool value_init )
+	{
+		// offset + n * sizeof( T ) が溢れないこと
+		if ( n > ( SIZE_MAX - offset ) / sizeof( T ) ) throw std::bad_array_new_length() ;
+
+		void * mem = ::operator new( offset + n * sizeof( T ) ) ;
+		header * h = ::new( mem ) header{ 1, n } ;
+		T * elems = reinterpret_cast< T * >( static_cast< char * >( mem ) + offset ) ;
+
+		std::size_t i = 0 ;
+		try {
+			for ( ; i < n ; ++i ){
+				if ( value_init ) ::new( static_cast< void * >( elems + i ) ) T() ;
+				else ::new( static_cast< void * >( elems + i ) ) T ;
+			}
+		} catch ( ... ){
+			destroy( elems, i ) ;
+			::operator delete( mem ) ;
+			throw ;
+		}
+
+		shared_ptr r ;
+		r.ptr = elems ;
+		r.block = h ;
+		return r ;
+	}
+
+	void release(){
+		if ( block == nullptr ) return ;
+
+		--block->count ;
+		if ( block->count == 0 ){
+			destroy( ptr, block->length ) ;
+			::operator delete( block ) ;
+		}
+		ptr = nullptr ;
+		block = nullptr ;
+	}
+
+public :
+	shared_ptr() { }
+	~shared_ptr()
+	{
+		release() ;
+	}
+
+	shared_ptr( const shared_ptr & r )
+	: ptr( r.ptr ), block( r.block )
+	{
+		if ( block ) ++block->count ;
+	}
+	shared_ptr & operator =( const shared_ptr & r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ptr = r.ptr ;
+		block = r.block ;
+		if ( block ) ++block->count ;
+		return *this ;
+	}
+
+	shared_ptr( shared_ptr && r )
+	: ptr( r.ptr ), block( r.block )
+	{
+		r.ptr = nullptr ;
+		r.block = nullptr ;
+	}
+	shared_ptr & operator =( shared_ptr && r )
+	{
+		if ( this == &r )
+			return *this ;
+
+		release() ;
+		ptr = r.ptr ;
+		block = r.block ;
+		r.ptr = nullptr ;
+		r.block = nullptr ;
+		return *this ;
+	}
+
+	T & operator []( std::size_t i ) const noexcept
+	{
+		assert( i < size() ) ;
+		return ptr[i] ;
+	}
+	T * get() const noexcept { return ptr ; }
+	std::size_t size() const noexcept { return block ? block->length : 0 ; }
+
+	T * begin() const noexcept { return ptr ; }
+	T * end() const noexcept { return ptr + size() ; }
+
+	std::size_t use_count() const noexcept { return block ? block->count : 0 ; }
+	bool unique() const noexcept { return use_count() == 1 ; }
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
+} ;
+
+// make_shared<T[]> の戻り値。要素数を持たない配列型のときのみ有効
+template < typename U >
+struct shared_array_result : std::enable_if< std::is_array< U >::value && std::extent< U >::value == 0, shared_ptr< U > > { } ;
+
+template < typename U >
+typename shared_array_result< U >::type make_shared( std::size_t n )
+{
+	return shared_array_result< U >::type::create( n, true ) ;
+}
+
+template < typename U >
+typename shared_array_result< U >::type make_shared_for_overwrite( std::size_t n )
+{
+	return shared_array_result< U >::type::create( n, false ) ;
+}
@@ -0,0 +1,170 @@
+/************************************************************
+■slot map
+	weak_ptrの代わりに、世代番号付きのhandleでobjectを参照するcontainer。
+
+	-	objectは std::vector に詰めて(dense)保持するので、全objectの走査は連続メモリの線形走査になる。
+	-	handle = index(下位32bit) + generation(上位32bit) の64bit値。
+	-	get() は 範囲check + generation比較 のみ。control blockもrefcountも無い。
+	-	generation は 奇数 = 使用中、偶数 = 空き。eraseで進めるので、古いhandleは get() で nullptr になる。
+	-	null_handle(= 0) は generation 0 なので、どのobjectも指さない。
+	-	generation を使い切ったslotは再利用しない(一周して古いhandleが生き返らないように)。
+************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <utility>
+
+template < typename T >
+class slot_map
+{
+public :
+	typedef std::uint64_t handle ;
+	static const handle null_handle = 0 ;
+
+private :
+	struct slot {
+		std::uint32_t index ;		// 使用中 : values中の位置、空き : 次の空きslot
+		std::uint32_t generation ;
+	} ;
+
+	static const std::uint32_t npos = 0xffffffffu ;
+	static const std::uint32_t last_generation = 0xfffffffeu ;	// 空き(偶数)の最大値
+
+	std::vector< T > values ;					// dense
+	std::vector< std::uint32_t > value_to_slot ;	// values[i] を指しているslot
+	std::vector< slot > slots ;
+	std::uint32_t free_head = npos ;
+
+	static std::uint32_t index_of( handle h ) noexcept { return std::uint32_t( h ) ; }
+	static std::uint32_t generation_of( handle h ) noexcept { return std::uint32_t( h >> 32 ) ; }
+	static handle make_handle( std::uint32_t index, std::uint32_t generation ) noexcept
+	{
+		return ( handle( generation ) << 32 ) | index ;
+	}
+
+	// handleが生きていれば、slotを返す
+	const slot * find_slot( handle h ) const noexcept
+	{
+		std::uint32_t i = index_of( h ) ;
+		if ( i >= slots.size() ) return nullptr ;
+
+		const slot & s = slots[i] ;
+		if ( ( s.generation & 1 ) == 0 || s.generation != generation_of( h ) ) return nullptr ;
+		return &s ;
+	}
+
+	// 満杯なら容量を倍にする。push_back 自体は例外を投げないようにするため
+	template < typename U >
+	static void grow( std::vector< U > & v )
+	{
+		if ( v.size() == v.capacity() ) v.reserve( v.empty() ? 8 : v.size() * 2 ) ;
+	}
+
+	// 使用中slotを空きにする。generationを使い切ったら free list に戻さない
+	void free_slot( std::uint32_t slot_index ) noexcept
+	{
+		slot & s = slots[slot_index] ;
+		++s.generation ;
+		if ( s.generation == last_generation ) return ;
+
+		s.index = free_head ;
+		free_head = slot_index ;
+	}
+
+public :
+	// 空いているslotを再利用して、objectを末尾に構築する
+	template < typename ... Args >
+	handle emplace( Args && ... args )
+	{
+		// 例外を投げうる処理(確保、Tの構築)を先に済ませる
+		if ( free_head == npos ){
+			if ( slots.size() >= npos ) throw std::length_error( "slot_map: too many slots" ) ;
+			grow( slots ) ;
+		}
+		grow( value_to_slot ) ;
+		values.emplace_back( std::forward< Args >( args ) ... ) ;
+
+		// ここから先は例外を投げない
+		std::uint32_t slot_index ;
+		if ( free_head != npos ){
+			slot_index = free_head ;
+			free_head = slots[slot_index].index ;
+		}else{
+			slot_index = std::uint32_t( slots.size() ) ;
+			slots.push_back( slot{ npos, 0 } ) ;
+		}
+		value_to_slot.push_back( slot_index ) ;
+
+		slot & s = slots[slot_index] ;
+		++s.generation ;
+		s.index = std::uint32_t( values.size() - 1 ) ;
+		return make_handle( slot_index, s.generation ) ;
+	}
+
+	handle insert( const T & value ) { return emplace( value ) ; }
+	handle insert( T && value ) { return emplace( std::move( value ) ) ; }
+
+	// 末尾のobjectを穴に移して詰める(swap and pop)
+	bool erase( handle h )
+	{
+		if ( find_slot( h ) == nullptr ) return false ;
+
+		std::uint32_t slot_index = index_of( h ) ;
+		std::uint32_t hole = slots[slot_index].index ;
+		std::uint32_t last = std::uint32_t( values.size() - 1 ) ;
+
+		if ( hole != last ){
+			values[hole] = std::move( values[last] ) ;
+			value_to_slot[hole] = value_to_slot[last] ;
+			slots[ value_to_slot[hole] ].index = hole ;
+		}
+		values.pop_back() ;
+		value_to_slot.pop_back() ;
+
+		// generationを進めて、古いhandleを無効化
+		free_slot( slot_index ) ;
+
+		return true ;
+	}
+
+	T * get( handle h ) noexcept
+	{
+		const slot * s = find_slot( h ) ;
+		return s ? &values[ s->index ] : nullptr ;
+	}
+	const T * get( handle h ) const noexcept
+	{
+		const slot * s = find_slot( h ) ;
+		return s ? &values[ s->index ] : nullptr ;
+	}
+
+	bool contains( handle h ) const noexcept { return find_slot( h ) != nullptr ; }
+
+	void clear()
+	{
+		for ( std::uint32_t v : value_to_slot ) free_slot( v ) ;
+		values.clear() ;
+		value_to_slot.clear() ;
+	}
+
+	void reserve( std::size_t n )
+	{
+		values.reserve( n ) ;
+		value_to_slot.reserve( n ) ;
+		slots.reserve( n ) ;
+	}
+
+	std::size_t size() const noexcept { return values.size() ; }
+	bool empty() const noexcept { return values.empty() ; }
+
+	// 生きているobjectだけを、連続メモリ上で走査
+	typename std::vector< T >::iterator begin() noexcept { return values.begin() ; }
+	typename std::vector< T >::iterator end() noexcept { return values.end() ; }
+	typename std::vector< T >::const_iterator begin() const noexcept { return values.begin() ; }
+	typename std::vector< T >::const_iterator end() const noexcept { return values.end() ; }
+
+	T * data() noexcept { return values.data() ; }
+	const T * data() const noexcept { return values.data() ; }
+} ;
@@ -2,6 +2,8 @@
 ■スマートポインター
 	https://cpp.rainy.me/040-smart-pointer.html#unique-ptr
 ************************************************************/
+#pragma once
+
 template < typename T >
 class unique_ptr
 {
@@ -22,14 +24,33 @@ public :
 	unique_ptr( unique_ptr && r ) : ptr( r.ptr ) { r.ptr = nullptr ; }
 	unique_ptr & operator = ( unique_ptr && r )
 	{
+		if ( this == &r )
+			return *this ;
+
 		delete ptr ;
 		ptr = r.ptr ;
 		r.ptr = nullptr ;
+		return *this ;
+	}
+
+	// 所有権を放棄し、raw pointerを返す
+	T * release() noexcept
+	{
+		T * p = ptr ;
+		ptr = nullptr ;
+		return p ;
+	}
+	void reset( T * _ptr = nullptr )
+	{
+		T * old = ptr ;
+		ptr = _ptr ;
+		delete old ;
 	}
 
-	T & operator * () noexcept { return *ptr ; }
-	T * operator ->() noexcept { return ptr ; } 
-	T * get() noexcept { return ptr ; }
+	T & operator * () const noexcept { return *ptr ; }
+	T * operator ->() const noexcept { return ptr ; } 
+	T * get() const noexcept { return ptr ; }
+	explicit operator bool() const noexcept { return ptr != nullptr ; }
 } ;
 
 
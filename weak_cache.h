@@ -0,0 +1,199 @@
+/************************************************************
+■weak_cache
+	weak_ptr を値に持つ、thread safeな interning table。
+	「key K の object を誰かがまだ持っていればそれを、いなければ新しく作って」を1回の呼び出しで行う。
+
+		std::shared_ptr<V> p = cache.get_or_create( key, []{ return std::make_shared<V>( ... ) ; } ) ;
+
+	-	tableは hash で Shards 個に分割し、shard毎に reader/writer lock を持つ。
+		読み出し(find、既に生きているobjectの get_or_create)は shared lock のみで、
+		書き込み(作成、掃除)が無い限り readers が lock の中で互いを待つことは無い。
+		異なるshardへのaccessは完全に独立。
+	制限 : shared lock の取得/解放は shared_mutex への atomic な read-modify-write。
+		同じshard(特に同じ熱いkey)を多数のcoreが読むと、その cache line の奪い合いで
+		読み出しも core数に対してscaleしない。lock-freeではない。
+		そのような key は、取得した shared_ptr を呼び出し側で保持して使い回すこと。
+		(weak_ptr の lock() 自体も、objectの共有countへの atomic 操作を伴う)
+	-	同じkeyに対して同時に get_or_create しても、make は1回しか呼ばれない。
+		作成中の entry には pending を置き、他のthreadは lock の外でその完成を待つ。
+		make が例外を投げた場合は、待っていたthreadの1つが作り直す。
+	-	cacheは所有権を持たない(weak_ptr)ので、objectは最後の shared_ptr が消えた時点で解放される。
+		期限切れの entry は、shard の entry 数が閾値を越えた時にまとめて掃除する。
+************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+
+template < typename K, typename V, typename Hash = std::hash< K >, std::size_t Shards = 64 >
+class weak_cache
+{
+private :
+	static_assert( ( Shards & ( Shards - 1 ) ) == 0, "Shards must be a power of two" ) ;
+
+	static const std::size_t min_purge = 64 ;
+
+	// 作成中のobject。完成(または失敗)まで他のthreadを待たせる
+	struct pending {
+		std::mutex m ;
+		std::condition_variable cv ;
+		bool done = false ;
+		std::shared_ptr< V > result ;	// 失敗時は空
+	} ;
+
+	struct entry {
+		std::weak_ptr< V > value ;
+		std::shared_ptr< pending > building ;
+	} ;
+
+	struct alignas( 64 ) shard {
+		mutable std::shared_mutex m ;
+		std::unordered_map< K, entry, Hash > map ;
+		std::size_t purge_at = min_purge ;
+	} ;
+
+	Hash hash ;
+	shard shards[ Shards ] ;
+
+	shard & shard_of( const K & key ) { return shards[ hash( key ) & ( Shards - 1 ) ] ; }
+	const shard & shard_of( const K & key ) const { return shards[ hash( key ) & ( Shards - 1 ) ] ; }
+
+	// exclusive lock 中に呼ぶ
+	static void purge_locked( shard & s )
+	{
+		for ( auto it = s.map.begin() ; it != s.map.end() ; ){
+			if ( !it->second.building && it->second.value.expired() ) it = s.map.erase( it ) ;
+			else ++it ;
+		}
+		s.purge_at = s.map.size() * 2 < min_purge ? min_purge : s.map.size() * 2 ;
+	}
+
+	static std::shared_ptr< V > wait( pending & p )
+	{
+		std::unique_lock< std::mutex > lock( p.m ) ;
+		p.cv.wait( lock, [&]{ return p.done ; } ) ;
+		return p.result ;
+	}
+
+	static void finish( pending & p, std::shared_ptr< V > result )
+	{
+		{
+			std::lock_guard< std::mutex > lock( p.m ) ;
+			p.done = true ;
+			p.result = std::move( result ) ;
+		}
+		p.cv.notify_all() ;
+	}
+
+public :
+	weak_cache() { }
+	explicit weak_cache( const Hash & _hash ) : hash( _hash ) { }
+
+	// コピーは禁止
+	weak_cache( const weak_cache & ) = delete ;
+	weak_cache & operator =( const weak_cache & ) = delete ;
+
+	// 生きていれば返す。いなければ空
+	std::shared_ptr< V > find( const K & key ) const
+	{
+		const shard & s = shard_of( key ) ;
+		std::shared_lock< std::shared_mutex > lock( s.m ) ;
+
+		auto it = s.map.find( key ) ;
+		return it == s.map.end() ? std::shared_ptr< V >() : it->second.value.lock() ;
+	}
+
+	// make : std::shared_ptr<V>() を返す関数。keyごとに同時に1つしか呼ばれない
+	template < typename F >
+	std::shared_ptr< V > get_or_create( const K & key, F && make )
+	{
+		shard & s = shard_of( key ) ;
+
+		for ( ;; ){
+			std::shared_ptr< pending > other ;
+
+			// 1. shared lock : 既に生きていれば、それで終わり
+			{
+				std::shared_lock< std::shared_mutex > lock( s.m ) ;
+				auto it = s.map.find( key ) ;
+				if ( it != s.map.end() ){
+					if ( std::shared_ptr< V > p = it->second.value.lock() ) return p ;
+					other = it->second.building ;
+				}
+			}
+
+			// 2. 誰かが作成中なら、lock の外で待つ
+			if ( other ){
+				if ( std::shared_ptr< V > p = wait( *other ) ) return p ;
+				continue ;
+			}
+
+			// 3. exclusive lock : 再確認して、自分が作成者になる
+			std::shared_ptr< pending > mine ;
+			{
+				std::unique_lock< std::shared_mutex > lock( s.m ) ;
+				entry & e = s.map[key] ;
+				if ( std::shared_ptr< V > p = e.value.lock() ) return p ;
+				if ( e.building ){
+					other = e.building ;
+				}else{
+					mine = std::make_shared< pending >() ;
+					e.building = mine ;
+					if ( s.map.size() >= s.purge_at ) purge_locked( s ) ;
+				}
+			}
+			if ( other ){
+				if ( std::shared_ptr< V > p = wait( *other ) ) return p ;
+				continue ;
+			}
+
+			// 4. lock の外で作成し、entry に登録
+			std::shared_ptr< V > result ;
+			try {
+				result = make() ;
+			} catch ( ... ){
+				{
+					std::unique_lock< std::shared_mutex > lock( s.m ) ;
+					s.map[key].building.reset() ;
+				}
+				finish( *mine, nullptr ) ;
+				throw ;
+			}
+
+			{
+				std::unique_lock< std::shared_mutex > lock( s.m ) ;
+				entry & e = s.map[key] ;
+				e.value = result ;
+				e.building.reset() ;
+			}
+			finish( *mine, result ) ;
+			return result ;
+		}
+	}
+
+	// 期限切れの entry を全shardから掃除する
+	void purge()
+	{
+		for ( shard & s : shards ){
+			std::unique_lock< std::shared_mutex > lock( s.m ) ;
+			purge_locked( s ) ;
+		}
+	}
+
+	// 期限切れを含む entry 数(概算)
+	std::size_t size() const
+	{
+		std::size_t n = 0 ;
+		for ( const shard & s : shards ){
+			std::shared_lock< std::shared_mutex > lock( s.m ) ;
+			n += s.map.size() ;
+		}
+		return n ;
+	}
+} ;